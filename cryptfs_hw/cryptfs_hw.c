@@ -27,23 +27,31 @@
  */
 
 #define LOG_TAG "Cryptfs_hw"
+#define ATRACE_TAG ATRACE_TAG_HAL
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <unistd.h>
 #include <linux/qseecom.h>
 #include <hardware/keymaster_common.h>
 #include <hardware/hardware.h>
 #include "cutils/log.h"
 #include "cutils/properties.h"
 #include "cutils/android_reboot.h"
+#include "cutils/trace.h"
 #include "cryptfs_hw.h"
+#include "cryptfs_hw_keyslot.h"
+#include "cryptfs_hw_log.h"
 
 #define QSEECOM_LIBRARY_NAME "libQSEEComAPI.so"
 
@@ -62,6 +70,9 @@
 #define UPDATE_HW_DISK_ENC_KEY				2
 
 static int loaded_library = 0;
+static const hw_module_t* keymaster_module;
+static hw_device_t* keymaster_device;
+static pthread_mutex_t keymaster_lock = PTHREAD_MUTEX_INITIALIZER;
 static int (*qseecom_create_key)(int, void*);
 static int (*qseecom_update_key)(int, void*, void*);
 static int (*qseecom_wipe_key)(int);
@@ -92,6 +103,81 @@ static inline void* secure_memset(void* v, int c , size_t n)
 	return v;
 }
 
+/*
+ * Key material buffers handed to the QSEECom key calls. They are carved
+ * out of one locked, non-dumpable mapping created on first use, so a key
+ * operation does no allocation and no mmap/munmap of its own.
+ */
+#define CRYPTFS_HW_BUF_COUNT				8
+
+static unsigned char *buf_pool;
+static unsigned int buf_pool_used;
+static pthread_mutex_t buf_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int buf_pool_init()
+{
+	size_t len = CRYPTFS_HW_BUF_COUNT * MAX_PASSWORD_LEN;
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED) {
+		SLOGE("%s: Failed to map key buffer pool (%s)\n", __func__, strerror(errno));
+		return -1;
+	}
+	if (mlock(p, len))
+		SLOGW("%s: Failed to lock key buffer pool (%s)\n", __func__, strerror(errno));
+	madvise(p, len, MADV_DONTDUMP);
+	buf_pool = p;
+	return 0;
+}
+
+static unsigned char* buf_get()
+{
+	unsigned char *buf = NULL;
+	int i;
+
+	pthread_mutex_lock(&buf_pool_lock);
+	if (buf_pool || !buf_pool_init()) {
+		for (i = 0; i < CRYPTFS_HW_BUF_COUNT; i++) {
+			if (!(buf_pool_used & (1u << i))) {
+				buf_pool_used |= 1u << i;
+				buf = buf_pool + i * MAX_PASSWORD_LEN;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&buf_pool_lock);
+	return buf;
+}
+
+static void buf_put(unsigned char *buf)
+{
+	if (!buf)
+		return;
+	secure_memset(buf, 0, MAX_PASSWORD_LEN);
+	pthread_mutex_lock(&buf_pool_lock);
+	buf_pool_used &= ~(1u << ((buf - buf_pool) / MAX_PASSWORD_LEN));
+	pthread_mutex_unlock(&buf_pool_lock);
+}
+
+/*
+ * Resident set size of this process in KiB. Used to report what mapping
+ * the vendor crypto stack costs, which is what an unencrypted boot saves
+ * by never getting this far.
+ */
+static long get_rss_kb()
+{
+    long size = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (!f)
+        return 0;
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
 static int is_qseecom_up()
 {
     int i = 0;
@@ -112,11 +198,20 @@ static int load_qseecom_library()
     if (loaded_library)
         return loaded_library;
 
-    if (!is_qseecom_up()) {
+    /*
+     * The trace spans below go to trace_marker when the HAL atrace tag
+     * is enabled and cost a single branch otherwise.
+     */
+    ATRACE_BEGIN("cryptfs_hw: wait for qseecom");
+    int up = is_qseecom_up();
+    ATRACE_END();
+    if (!up) {
         SLOGE("Timed out waiting for QSEECom listeners. Aborting FDE key operation");
         return 0;
     }
 
+    ATRACE_BEGIN("cryptfs_hw: bind " QSEECOM_LIBRARY_NAME);
+    long rss = get_rss_kb();
     void * handle = dlopen(QSEECOM_LIBRARY_NAME, RTLD_NOW);
     if (handle) {
         dlerror(); /* Clear any existing error */
@@ -130,7 +225,7 @@ static int load_qseecom_library()
                 *(void **) (&qseecom_wipe_key) = dlsym(handle, "QSEECom_wipe_key");
                 if ((error = dlerror()) == NULL) {
                     loaded_library = 1;
-                    SLOGD("Success loading QSEECom_wipe_key \n");
+                    cryptfs_hw_log(CRYPTFS_HW_LOG_QSEECOM_LOADED, 0);
                 }
                 else
                     SLOGE("Error %s loading symbols for QSEECom APIs \n", error);
@@ -142,8 +237,13 @@ static int load_qseecom_library()
         SLOGE("Could not load libQSEEComAPI.so \n");
     }
 
+    ATRACE_END();
+
     if (error)
         dlclose(handle);
+    else if (loaded_library)
+        SLOGI("Loaded %s, resident set grew by %ld KiB\n", QSEECOM_LIBRARY_NAME,
+              get_rss_kb() - rss);
 
     return loaded_library;
 }
@@ -151,31 +251,75 @@ static int load_qseecom_library()
 static int cryptfs_hw_create_key(enum cryptfs_hw_key_management_usage_type usage,
 					unsigned char *hash32)
 {
-	if (load_qseecom_library())
-		return qseecom_create_key(usage, hash32);
-
-	return CRYPTFS_HW_CREATE_KEY_FAILED;
+	int ret = CRYPTFS_HW_CREATE_KEY_FAILED;
+
+	/*
+	 * Retrying the same password, or unlocking again, would otherwise
+	 * reprogram a key slot that already holds this very key.
+	 */
+	ret = cryptfs_hw_keyslot_lookup(usage, hash32, MAX_PASSWORD_LEN);
+	if (ret >= 0) {
+		cryptfs_hw_log(CRYPTFS_HW_LOG_KEYSLOT_HIT, ret);
+		return ret;
+	}
+
+	ret = CRYPTFS_HW_CREATE_KEY_FAILED;
+	if (load_qseecom_library()) {
+		ATRACE_BEGIN("cryptfs_hw: QSEECom_create_key");
+		ret = qseecom_create_key(usage, hash32);
+		ATRACE_END();
+	}
+
+	if (ret >= 0)
+		cryptfs_hw_keyslot_store(usage, hash32, MAX_PASSWORD_LEN, ret);
+	else
+		cryptfs_hw_keyslot_invalidate(usage);
+	cryptfs_hw_log(CRYPTFS_HW_LOG_CREATE_KEY, ret);
+	return ret;
 }
 
 static int cryptfs_hw_wipe_key(enum cryptfs_hw_key_management_usage_type usage)
 {
-	if (load_qseecom_library())
-		return qseecom_wipe_key(usage);
+	int ret = CRYPTFS_HW_WIPE_KEY_FAILED;
+
+	cryptfs_hw_keyslot_invalidate(usage);
+	if (load_qseecom_library()) {
+		ATRACE_BEGIN("cryptfs_hw: QSEECom_wipe_key");
+		ret = qseecom_wipe_key(usage);
+		ATRACE_END();
+	}
 
-	return CRYPTFS_HW_WIPE_KEY_FAILED;
+	cryptfs_hw_log(CRYPTFS_HW_LOG_WIPE_KEY, ret);
+	return ret;
 }
 
 static int cryptfs_hw_update_key(enum cryptfs_hw_key_management_usage_type usage,
 			unsigned char *current_hash32, unsigned char *new_hash32)
 {
-	if (load_qseecom_library())
-		return qseecom_update_key(usage, current_hash32, new_hash32);
+	int ret = CRYPTFS_HW_UPDATE_KEY_FAILED;
+
+	cryptfs_hw_keyslot_invalidate(usage);
+	if (load_qseecom_library()) {
+		ATRACE_BEGIN("cryptfs_hw: QSEECom_update_key_user_info");
+		ret = qseecom_update_key(usage, current_hash32, new_hash32);
+		ATRACE_END();
+	}
 
-	return CRYPTFS_HW_UPDATE_KEY_FAILED;
+	cryptfs_hw_log(CRYPTFS_HW_LOG_UPDATE_KEY, ret);
+	return ret;
 }
 
 static int map_usage(int usage)
 {
+#if defined(CRYPTFS_HW_BOOTDEVICE_UFS)
+    if (usage == CRYPTFS_HW_KM_USAGE_DISK_ENCRYPTION && is_ice_enabled())
+        return CRYPTFS_HW_KM_USAGE_UFS_ICE_DISK_ENCRYPTION;
+    return usage;
+#elif defined(CRYPTFS_HW_BOOTDEVICE_SDCC)
+    if (usage == CRYPTFS_HW_KM_USAGE_DISK_ENCRYPTION && is_ice_enabled())
+        return CRYPTFS_HW_KM_USAGE_SDCC_ICE_DISK_ENCRYPTION;
+    return usage;
+#else
     int storage_type = is_ice_enabled();
     if (usage == CRYPTFS_HW_KM_USAGE_DISK_ENCRYPTION) {
         if (storage_type == QTI_ICE_STORAGE_UFS) {
@@ -186,6 +330,7 @@ static int map_usage(int usage)
         }
     }
     return usage;
+#endif
 }
 
 static unsigned char* get_tmp_passwd(const char* passwd)
@@ -193,13 +338,13 @@ static unsigned char* get_tmp_passwd(const char* passwd)
     int passwd_len = 0;
     unsigned char * tmp_passwd = NULL;
     if(passwd) {
-        tmp_passwd = (unsigned char*)malloc(MAX_PASSWORD_LEN);
+        tmp_passwd = buf_get();
         if(tmp_passwd) {
             secure_memset(tmp_passwd, 0, MAX_PASSWORD_LEN);
             passwd_len = strnlen(passwd, MAX_PASSWORD_LEN);
             memcpy(tmp_passwd, passwd, passwd_len);
         } else {
-            SLOGE("%s: Failed to allocate memory for tmp passwd \n", __func__);
+            SLOGE("%s: No free key buffer for tmp passwd \n", __func__);
         }
     } else {
         SLOGE("%s: Passed argument is NULL \n", __func__);
@@ -219,21 +364,19 @@ static int set_key(const char* currentpasswd, const char* passwd, const char* en
         unsigned char* tmp_currentpasswd = get_tmp_passwd(currentpasswd);
         if (tmp_passwd) {
             if (operation == UPDATE_HW_DISK_ENC_KEY) {
-                if (tmp_currentpasswd) {
+                if (tmp_currentpasswd)
                    err = cryptfs_hw_update_key(map_usage(CRYPTFS_HW_KM_USAGE_DISK_ENCRYPTION), tmp_currentpasswd, tmp_passwd);
-                   secure_memset(tmp_currentpasswd, 0, MAX_PASSWORD_LEN);
-                }
             } else if (operation == SET_HW_DISK_ENC_KEY) {
                 err = cryptfs_hw_create_key(map_usage(CRYPTFS_HW_KM_USAGE_DISK_ENCRYPTION), tmp_passwd);
             }
             if(err < 0) {
                 if(ERR_MAX_PASSWORD_ATTEMPTS == err)
                     SLOGI("Maximum wrong password attempts reached, will erase userdata\n");
+                cryptfs_hw_log_flush(-1);
             }
-            secure_memset(tmp_passwd, 0, MAX_PASSWORD_LEN);
-            free(tmp_passwd);
-            free(tmp_currentpasswd);
         }
+        buf_put(tmp_passwd);
+        buf_put(tmp_currentpasswd);
     }
     return err;
 }
@@ -252,31 +395,35 @@ unsigned int is_hw_disk_encryption(const char* encryption_mode)
 {
     int ret = 0;
     if(encryption_mode) {
-        if (!strcmp(encryption_mode, "aes-xts")) {
-            SLOGD("HW based disk encryption is enabled \n");
+        if (!strcmp(encryption_mode, "aes-xts"))
             ret = 1;
-        }
     }
+    cryptfs_hw_log(CRYPTFS_HW_LOG_HW_DISK_ENCRYPTION, ret);
     return ret;
 }
 
-int is_ice_enabled(void)
+/*
+ * Boards that know their boot device at build time (see Android.bp) get
+ * the storage type as a constant, or, for SDCC, the ICE node probed once;
+ * the generic variant keeps looking at ro.boot.bootdevice on every call.
+ */
+static int get_ice_storage_type(void)
 {
+#if defined(CRYPTFS_HW_BOOTDEVICE_UFS)
+  /* All UFS based devices has ICE in it */
+  return QTI_ICE_STORAGE_UFS;
+#elif defined(CRYPTFS_HW_BOOTDEVICE_SDCC)
+  static int storage_type = -1;
+
+  if (storage_type < 0) {
+    storage_type = access("/dev/icesdcc", F_OK) != -1 ? QTI_ICE_STORAGE_SDCC : 0;
+    cryptfs_hw_log(CRYPTFS_HW_LOG_ICE_STORAGE, storage_type);
+  }
+  return storage_type;
+#else
   char prop_storage[PATH_MAX];
   int storage_type = 0;
 
-  /*
-   * Since HW FDE is a compile time flag (due to QSSI requirements),
-   * this API conflicts with Metadata encryption even when ICE is
-   * enabled, as it encrypts the whole disk instead. Adding this
-   * workaround to return 0 if metadata partition is present.
-   */
-
-  if (access(METADATA_PARTITION_NAME, F_OK) == 0) {
-    SLOGI("Metadata partition, returning false");
-    return 0;
-  }
-
   if (property_get("ro.boot.bootdevice", prop_storage, "")) {
     if (strstr(prop_storage, "ufs")) {
       /* All UFS based devices has ICE in it. So we dont need
@@ -288,7 +435,26 @@ int is_ice_enabled(void)
         storage_type = QTI_ICE_STORAGE_SDCC;
     }
   }
+  cryptfs_hw_log(CRYPTFS_HW_LOG_ICE_STORAGE, storage_type);
   return storage_type;
+#endif
+}
+
+int is_ice_enabled(void)
+{
+  /*
+   * Since HW FDE is a compile time flag (due to QSSI requirements),
+   * this API conflicts with Metadata encryption even when ICE is
+   * enabled, as it encrypts the whole disk instead. Adding this
+   * workaround to return 0 if metadata partition is present.
+   */
+
+  if (access(METADATA_PARTITION_NAME, F_OK) == 0) {
+    cryptfs_hw_log(CRYPTFS_HW_LOG_ICE_METADATA, 0);
+    return 0;
+  }
+
+  return get_ice_storage_type();
 }
 
 int clear_hw_device_encryption_key()
@@ -296,17 +462,84 @@ int clear_hw_device_encryption_key()
 	return cryptfs_hw_wipe_key(map_usage(CRYPTFS_HW_KM_USAGE_DISK_ENCRYPTION));
 }
 
-static int get_keymaster_version()
+/*
+ * The keystore module is only resolved the first time the KEK path asks
+ * for it, i.e. once /data has been found to be encrypted, and is kept for
+ * the session so password retries do not go through the HAL loader again.
+ * Must be called with keymaster_lock held.
+ */
+static const hw_module_t* get_keymaster_module()
 {
     int rc = -1;
+    long rss;
     const hw_module_t* mod;
+
+    if (keymaster_module)
+        return keymaster_module;
+
+    rss = get_rss_kb();
+    ATRACE_BEGIN("cryptfs_hw: hw_get_module_by_class");
     rc = hw_get_module_by_class(KEYSTORE_HARDWARE_MODULE_ID, NULL, &mod);
+    ATRACE_END();
+    cryptfs_hw_log(CRYPTFS_HW_LOG_KEYMASTER_VERSION, rc ? rc : mod->module_api_version);
     if (rc) {
         SLOGE("could not find any keystore module");
-        return rc;
+        cryptfs_hw_log_flush(-1);
+        return NULL;
+    }
+    SLOGI("Loaded keystore module, resident set grew by %ld KiB", get_rss_kb() - rss);
+
+    keymaster_module = mod;
+    return keymaster_module;
+}
+
+static int get_keymaster_version()
+{
+    const hw_module_t* mod;
+
+    pthread_mutex_lock(&keymaster_lock);
+    mod = get_keymaster_module();
+    pthread_mutex_unlock(&keymaster_lock);
+
+    return mod ? mod->module_api_version : -1;
+}
+
+/*
+ * Keymaster device shared by every KEK operation of the session. The
+ * device is opened through the module's generic open method, which
+ * covers the 0.3 API as well as keymaster1 and keymaster2; callers cast
+ * it according to the returned module API version; negative on error.
+ */
+int get_keymaster_device(struct hw_device_t** dev)
+{
+    int rc = -1;
+    const hw_module_t* mod;
+
+    pthread_mutex_lock(&keymaster_lock);
+    mod = get_keymaster_module();
+    if (mod && !keymaster_device) {
+        rc = mod->methods->open(mod, KEYSTORE_KEYMASTER, &keymaster_device);
+        if (rc) {
+            SLOGE("could not open keymaster device (%d)", rc);
+            keymaster_device = NULL;
+        }
+    }
+    if (keymaster_device) {
+        *dev = keymaster_device;
+        rc = mod->module_api_version;
     }
+    pthread_mutex_unlock(&keymaster_lock);
+    return rc;
+}
 
-    return mod->module_api_version;
+void release_keymaster_device()
+{
+    pthread_mutex_lock(&keymaster_lock);
+    if (keymaster_device) {
+        keymaster_device->close(keymaster_device);
+        keymaster_device = NULL;
+    }
+    pthread_mutex_unlock(&keymaster_lock);
 }
 
 int should_use_keymaster()
@@ -324,3 +557,7 @@ int should_use_keymaster()
     return rc;
 }
 
+void dump_hw_crypto_log(int fd)
+{
+	cryptfs_hw_log_flush(fd);
+}
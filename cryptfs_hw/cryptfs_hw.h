@@ -29,6 +29,8 @@
 #ifndef __CRYPTFS_HW_H_
 #define __CRYPTFS_HW_H_
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -38,13 +40,36 @@ extern "C" {
 #define START_ENC 0x1
 #define START_ENCDEC 0x3
 
+#define FBE_KEY_DESCRIPTOR_SIZE 8
+#define FBE_MAX_KEY_SIZE 64
+
+struct hw_device_t;
+
+struct fbe_key_request {
+    unsigned char descriptor[FBE_KEY_DESCRIPTOR_SIZE];
+    const unsigned char* key;
+    unsigned int size;
+};
+
 int set_hw_device_encryption_key(const char*, const char*);
 int update_hw_device_encryption_key(const char*, const char*, const char*);
 int clear_hw_device_encryption_key();
 unsigned int is_hw_disk_encryption(const char*);
 int is_ice_enabled(void);
 int should_use_keymaster();
+int get_keymaster_device(struct hw_device_t**);
+void release_keymaster_device();
 int set_ice_param(int flag);
+void dump_hw_crypto_log(int fd);
+int get_xts_aes_driver(size_t request_size, char* driver, size_t len);
+int install_fbe_keys(const struct fbe_key_request* keys, int count);
+int get_fbe_policy(const char* dir, unsigned char* descriptor);
+void forget_fbe_policy(const char* dir);
+void flush_fbe_policy_cache();
+int tune_scrypt_params(unsigned int target_ms, unsigned char* n_factor,
+                       unsigned char* r_factor, unsigned char* p_factor);
+int pbkdf2_hw(const char* passwd, const unsigned char* salt, size_t salt_len,
+              unsigned int iterations, int sha256, unsigned char* out, size_t out_len);
 
 #ifdef __cplusplus
 }
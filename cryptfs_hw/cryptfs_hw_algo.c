@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2020 The TWRP Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Cryptfs_hw"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if_alg.h>
+#include "cutils/log.h"
+#include "cryptfs_hw.h"
+
+#ifndef AF_ALG
+#define AF_ALG						38
+#endif
+#ifndef SOL_ALG
+#define SOL_ALG						279
+#endif
+
+/*
+ * msm8916 registers several xts(aes) providers (generic C, ARMv8 CE and
+ * the qcrypto engine) whose relative speed depends on the request size,
+ * so the kernel's static priority is not always the right pick. Each
+ * provider is timed once per process through AF_ALG at the two request
+ * sizes dm-crypt issues most, and the ranking is kept for the session.
+ *
+ * The result is advisory on this device. Its 3.10 dm-crypt only parses
+ * cipher-chainmode-ivmode and leaves the provider to the crypto API's
+ * priority order; a driver name can only go into the table on kernels
+ * with the "capi:" syntax (4.12 and later).
+ */
+#define CRYPTO_PROC					"/proc/crypto"
+#define CRYPTO_XTS_AES					"xts(aes)"
+#define CRYPTO_MAX_DRIVERS				8
+#define CRYPTO_DRIVER_LEN				CRYPTO_ALGO_LENGTH
+#define CRYPTO_XTS_KEY_LEN				64
+#define CRYPTO_XTS_IV_LEN				16
+#define CRYPTO_BENCH_BYTES				(1024 * 1024)
+
+static const size_t bench_sizes[] = { 4096, 65536 };
+#define CRYPTO_BENCH_SIZES	(sizeof(bench_sizes) / sizeof(bench_sizes[0]))
+
+struct crypto_driver {
+	char name[CRYPTO_DRIVER_LEN];
+	/* bytes per microsecond, per entry of bench_sizes */
+	double rate[CRYPTO_BENCH_SIZES];
+};
+
+static struct crypto_driver drivers[CRYPTO_MAX_DRIVERS];
+static int num_drivers = -1;
+static pthread_mutex_t drivers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int list_xts_drivers()
+{
+	char line[128], name[CRYPTO_DRIVER_LEN] = "", value[CRYPTO_DRIVER_LEN];
+	FILE *f = fopen(CRYPTO_PROC, "r");
+	int n = 0;
+
+	if (!f)
+		return 0;
+
+	while (fgets(line, sizeof(line), f) && n < CRYPTO_MAX_DRIVERS) {
+		if (sscanf(line, "name : %63s", value) == 1) {
+			strcpy(name, value);
+		} else if (sscanf(line, "driver : %63s", value) == 1 &&
+			   !strcmp(name, CRYPTO_XTS_AES)) {
+			strcpy(drivers[n].name, value);
+			n++;
+		}
+	}
+	fclose(f);
+	return n;
+}
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int crypt_once(int op, unsigned char *buf, size_t len)
+{
+	char cbuf[CMSG_SPACE(sizeof(int)) +
+		  CMSG_SPACE(sizeof(struct af_alg_iv) + CRYPTO_XTS_IV_LEN)] = { 0 };
+	struct iovec iov = { .iov_base = buf, .iov_len = len };
+	struct msghdr msg = {
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	struct cmsghdr *cmsg;
+	struct af_alg_iv *iv;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_ALG;
+	cmsg->cmsg_type = ALG_SET_OP;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	*(int *)CMSG_DATA(cmsg) = ALG_OP_ENCRYPT;
+
+	cmsg = CMSG_NXTHDR(&msg, cmsg);
+	cmsg->cmsg_level = SOL_ALG;
+	cmsg->cmsg_type = ALG_SET_IV;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(struct af_alg_iv) + CRYPTO_XTS_IV_LEN);
+	iv = (struct af_alg_iv *)CMSG_DATA(cmsg);
+	iv->ivlen = CRYPTO_XTS_IV_LEN;
+
+	if (sendmsg(op, &msg, 0) != (ssize_t)len)
+		return -1;
+	return read(op, buf, len) == (ssize_t)len ? 0 : -1;
+}
+
+static void bench_driver(struct crypto_driver *drv)
+{
+	struct sockaddr_alg sa = { .salg_family = AF_ALG, .salg_type = "skcipher" };
+	unsigned char key[CRYPTO_XTS_KEY_LEN];
+	unsigned char *buf = NULL;
+	int tfm, op = -1;
+	uint64_t start, elapsed;
+	size_t i, done;
+
+	memset(drv->rate, 0, sizeof(drv->rate));
+	strncpy((char *)sa.salg_name, drv->name, sizeof(sa.salg_name) - 1);
+
+	tfm = socket(AF_ALG, SOCK_SEQPACKET, 0);
+	if (tfm < 0)
+		return;
+
+	/* Two different key halves, xts rejects identical ones in FIPS mode */
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = i;
+	if (bind(tfm, (struct sockaddr *)&sa, sizeof(sa)) ||
+	    setsockopt(tfm, SOL_ALG, ALG_SET_KEY, key, sizeof(key)) ||
+	    (op = accept(tfm, NULL, 0)) < 0)
+		goto out;
+
+	buf = calloc(1, bench_sizes[CRYPTO_BENCH_SIZES - 1]);
+	if (!buf)
+		goto out;
+
+	for (i = 0; i < CRYPTO_BENCH_SIZES; i++) {
+		/* Warm up the transform before timing it */
+		if (crypt_once(op, buf, bench_sizes[i]))
+			goto out;
+		start = now_us();
+		for (done = 0; done < CRYPTO_BENCH_BYTES; done += bench_sizes[i])
+			if (crypt_once(op, buf, bench_sizes[i]))
+				goto out;
+		elapsed = now_us() - start;
+		drv->rate[i] = (double)done / (elapsed ? elapsed : 1);
+	}
+
+out:
+	free(buf);
+	if (op >= 0)
+		close(op);
+	close(tfm);
+	SLOGI("%s: %.1f MB/s at 4K, %.1f MB/s at 64K\n", drv->name,
+	      drv->rate[0], drv->rate[1]);
+}
+
+static void calibrate()
+{
+	int i;
+
+	num_drivers = list_xts_drivers();
+	for (i = 0; i < num_drivers; i++)
+		bench_driver(&drivers[i]);
+}
+
+static size_t size_dist(size_t a, size_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+int get_xts_aes_driver(size_t request_size, char* driver, size_t len)
+{
+	unsigned int slot = 0, i;
+	int best = -1;
+
+	/* Rank by the measured size nearest to the request */
+	for (i = 1; i < CRYPTO_BENCH_SIZES; i++) {
+		if (size_dist(request_size, bench_sizes[i]) <
+		    size_dist(request_size, bench_sizes[slot]))
+			slot = i;
+	}
+
+	pthread_mutex_lock(&drivers_lock);
+	if (num_drivers < 0)
+		calibrate();
+	for (i = 0; i < (unsigned int)num_drivers; i++) {
+		if (drivers[i].rate[slot] > 0 &&
+		    (best < 0 || drivers[i].rate[slot] > drivers[best].rate[slot]))
+			best = i;
+	}
+	if (best >= 0)
+		snprintf(driver, len, "%s", drivers[best].name);
+	pthread_mutex_unlock(&drivers_lock);
+
+	return best >= 0 ? 0 : -ENOENT;
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2020 The TWRP Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Cryptfs_hw"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "cutils/log.h"
+#include "cryptfs_hw.h"
+
+/*
+ * File based encryption support: batched installation of the per-user
+ * and device keys into the kernel keyring, and a cache of directory
+ * policies so that walking a tree (e.g. restoring /data) resolves the
+ * key of each directory once. Key derivation and storage stay with the
+ * caller; this only talks to the kernel.
+ */
+
+#define FBE_KEYRING_NAME				"fscrypt"
+#define FBE_KEY_DESC_PREFIX				"ext4:"
+#define FBE_ENCRYPTION_MODE_AES_256_XTS			1
+#define FBE_POLICY_CACHE_SIZE				256	/* power of two */
+
+#ifndef KEY_SPEC_SESSION_KEYRING
+#define KEY_SPEC_SESSION_KEYRING			-3
+#endif
+#ifndef KEYCTL_SEARCH
+#define KEYCTL_SEARCH					10
+#endif
+
+/* Matches struct ext4_encryption_key in the kernel */
+struct fbe_kernel_key {
+	uint32_t mode;
+	unsigned char raw[FBE_MAX_KEY_SIZE];
+	uint32_t size;
+};
+
+/* Matches struct ext4_encryption_policy in the kernel */
+struct fbe_kernel_policy {
+	char version;
+	char contents_encryption_mode;
+	char filenames_encryption_mode;
+	char flags;
+	unsigned char master_key_descriptor[FBE_KEY_DESCRIPTOR_SIZE];
+};
+
+#ifndef EXT4_IOC_GET_ENCRYPTION_POLICY
+#define EXT4_IOC_GET_ENCRYPTION_POLICY	_IOW('f', 21, struct fbe_kernel_policy)
+#endif
+
+struct fbe_policy_entry {
+	dev_t dev;
+	ino_t ino;
+	int valid;
+	unsigned char descriptor[FBE_KEY_DESCRIPTOR_SIZE];
+};
+
+static struct fbe_policy_entry policy_cache[FBE_POLICY_CACHE_SIZE];
+static pthread_mutex_t policy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void secure_wipe(void* v, size_t n)
+{
+	volatile unsigned char* p = (volatile unsigned char*)v;
+	while (n--) *p++ = 0;
+}
+
+static long fbe_keyring()
+{
+	long ring = syscall(__NR_keyctl, KEYCTL_SEARCH, KEY_SPEC_SESSION_KEYRING,
+			    "keyring", FBE_KEYRING_NAME, 0);
+	if (ring < 0)
+		ring = syscall(__NR_add_key, "keyring", FBE_KEYRING_NAME, NULL, 0,
+			       KEY_SPEC_SESSION_KEYRING);
+	return ring;
+}
+
+static void key_desc(const unsigned char *descriptor, char *desc)
+{
+	int i;
+
+	strcpy(desc, FBE_KEY_DESC_PREFIX);
+	for (i = 0; i < FBE_KEY_DESCRIPTOR_SIZE; i++)
+		sprintf(desc + strlen(FBE_KEY_DESC_PREFIX) + i * 2, "%02x", descriptor[i]);
+}
+
+/*
+ * Installs count keys with a single keyring lookup. Returns the number
+ * of keys installed; stops at the first failure.
+ */
+int install_fbe_keys(const struct fbe_key_request* keys, int count)
+{
+	char desc[sizeof(FBE_KEY_DESC_PREFIX) + FBE_KEY_DESCRIPTOR_SIZE * 2];
+	struct fbe_kernel_key key;
+	long ring;
+	int i, err;
+
+	ring = fbe_keyring();
+	if (ring < 0) {
+		err = errno;
+		SLOGE("%s: Failed to find %s keyring (%s)\n", __func__, FBE_KEYRING_NAME,
+		      strerror(err));
+		return -err;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (keys[i].size > FBE_MAX_KEY_SIZE) {
+			SLOGE("%s: Key %d is %u bytes, more than %d\n", __func__, i,
+			      keys[i].size, FBE_MAX_KEY_SIZE);
+			break;
+		}
+		memset(&key, 0, sizeof(key));
+		key.mode = FBE_ENCRYPTION_MODE_AES_256_XTS;
+		memcpy(key.raw, keys[i].key, keys[i].size);
+		key.size = keys[i].size;
+		key_desc(keys[i].descriptor, desc);
+		if (syscall(__NR_add_key, "logon", desc, &key, sizeof(key), ring) < 0) {
+			SLOGE("%s: Failed to install key %s (%s)\n", __func__, desc,
+			      strerror(errno));
+			break;
+		}
+	}
+	secure_wipe(&key, sizeof(key));
+	return i;
+}
+
+static unsigned int policy_hash(dev_t dev, ino_t ino)
+{
+	uint64_t h = ((uint64_t)dev << 32) ^ (uint64_t)ino;
+
+	h *= 0x9e3779b97f4a7c15ULL;
+	return (unsigned int)(h >> 32) & (FBE_POLICY_CACHE_SIZE - 1);
+}
+
+/*
+ * Looks up the master key descriptor of an encrypted directory. Results
+ * are cached by device and inode, so a directory that is asked about
+ * again costs a stat() instead of an open() and an ioctl(). A deleted
+ * directory's inode number can be reused by a new one, so callers that
+ * remove directories drop them with forget_fbe_policy() first, or flush
+ * the cache after wiping a tree.
+ */
+int get_fbe_policy(const char* dir, unsigned char* descriptor)
+{
+	struct fbe_kernel_policy policy;
+	struct fbe_policy_entry *e;
+	struct stat st;
+	int fd, rc;
+
+	if (stat(dir, &st))
+		return -errno;
+
+	pthread_mutex_lock(&policy_lock);
+	e = &policy_cache[policy_hash(st.st_dev, st.st_ino)];
+	if (e->valid && e->dev == st.st_dev && e->ino == st.st_ino) {
+		memcpy(descriptor, e->descriptor, FBE_KEY_DESCRIPTOR_SIZE);
+		pthread_mutex_unlock(&policy_lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&policy_lock);
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	rc = ioctl(fd, EXT4_IOC_GET_ENCRYPTION_POLICY, &policy);
+	if (rc)
+		rc = -errno;
+	close(fd);
+	if (rc)
+		return rc;
+
+	memcpy(descriptor, policy.master_key_descriptor, FBE_KEY_DESCRIPTOR_SIZE);
+	pthread_mutex_lock(&policy_lock);
+	e->dev = st.st_dev;
+	e->ino = st.st_ino;
+	memcpy(e->descriptor, descriptor, FBE_KEY_DESCRIPTOR_SIZE);
+	e->valid = 1;
+	pthread_mutex_unlock(&policy_lock);
+	return 0;
+}
+
+/* Drops the cached policy of dir; call it before removing dir */
+void forget_fbe_policy(const char* dir)
+{
+	struct fbe_policy_entry *e;
+	struct stat st;
+
+	if (stat(dir, &st))
+		return;
+
+	pthread_mutex_lock(&policy_lock);
+	e = &policy_cache[policy_hash(st.st_dev, st.st_ino)];
+	if (e->valid && e->dev == st.st_dev && e->ino == st.st_ino)
+		e->valid = 0;
+	pthread_mutex_unlock(&policy_lock);
+}
+
+void flush_fbe_policy_cache()
+{
+	pthread_mutex_lock(&policy_lock);
+	memset(policy_cache, 0, sizeof(policy_cache));
+	pthread_mutex_unlock(&policy_lock);
+}
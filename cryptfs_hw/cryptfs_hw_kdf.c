@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2020 The TWRP Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Cryptfs_hw"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/mem.h>
+#include "cutils/log.h"
+#include "cryptfs_hw.h"
+#include "cryptfs_hw_pool.h"
+
+/*
+ * KDFs for the crypto footer. The footer stores the scrypt parameters as
+ * log2 factors (N_factor, r_factor, p_factor); these are picked here from
+ * a benchmark on the running device instead of being fixed at build time.
+ * Older footers use PBKDF2 instead, which is computed here with its
+ * output blocks in parallel.
+ */
+#define SCRYPT_BENCH_N_FACTOR				10
+#define SCRYPT_MIN_N_FACTOR				12
+#define SCRYPT_MAX_N_FACTOR				17
+#define SCRYPT_R_FACTOR					3	/* r = 8 */
+#define SCRYPT_P_FACTOR					1	/* p = 2 */
+#define SCRYPT_KEY_LEN					32
+#define SCRYPT_SALT_LEN					16
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t time_scrypt(unsigned int n_factor)
+{
+	static const char passwd[] = "cryptfs_hw scrypt benchmark";
+	uint8_t salt[SCRYPT_SALT_LEN] = { 0 };
+	uint8_t key[SCRYPT_KEY_LEN];
+	uint64_t n = 1ULL << n_factor;
+	uint64_t r = 1ULL << SCRYPT_R_FACTOR;
+	uint64_t p = 1ULL << SCRYPT_P_FACTOR;
+	uint64_t start = now_us();
+
+	/* scrypt needs 128 * r * N bytes, plus headroom for the p lanes */
+	if (!EVP_PBE_scrypt(passwd, sizeof(passwd) - 1, salt, sizeof(salt), n, r, p,
+			    256 * r * n, key, sizeof(key)))
+		return -1;
+	return now_us() - start;
+}
+
+/*
+ * Picks the largest N (r and p fixed at vold's 8 and 2) whose scrypt
+ * run fits target_ms on this device. Scrypt time is linear in N, so one
+ * timed run at a small N is scaled up and the choice then checked with
+ * a real run, stepping down if it overshoots. The factors are returned
+ * for the caller to write into the footer along with the new password.
+ */
+int tune_scrypt_params(unsigned int target_ms, unsigned char* n_factor,
+		       unsigned char* r_factor, unsigned char* p_factor)
+{
+	uint64_t target_us = (uint64_t)target_ms * 1000;
+	int64_t t;
+	unsigned int n;
+
+	t = time_scrypt(SCRYPT_BENCH_N_FACTOR);
+	if (t <= 0)
+		return -EINVAL;
+
+	for (n = SCRYPT_MIN_N_FACTOR; n < SCRYPT_MAX_N_FACTOR; n++) {
+		if ((uint64_t)t << (n + 1 - SCRYPT_BENCH_N_FACTOR) > target_us)
+			break;
+	}
+	while (n > SCRYPT_MIN_N_FACTOR) {
+		t = time_scrypt(n);
+		if (t >= 0 && (uint64_t)t <= target_us)
+			break;
+		n--;
+	}
+
+	SLOGI("scrypt tuned to N=2^%u r=%u p=%u for %u ms\n", n,
+	      1 << SCRYPT_R_FACTOR, 1 << SCRYPT_P_FACTOR, target_ms);
+	*n_factor = n;
+	*r_factor = SCRYPT_R_FACTOR;
+	*p_factor = SCRYPT_P_FACTOR;
+	return 0;
+}
+
+#define PBKDF2_MAX_LANES				8
+
+struct pbkdf2_lane {
+	HMAC_CTX *keyed;
+	const EVP_MD *md;
+	const unsigned char *salt;
+	size_t salt_len;
+	unsigned int iterations;
+	uint32_t block;
+	unsigned char *out;
+	size_t out_len;
+	int rc;
+};
+
+/*
+ * Computes T_block = U_1 ^ ... ^ U_c. Each lane works on its own copy of
+ * the keyed HMAC state, so the password is only hashed into the inner
+ * and outer pads once; the SHA-1/SHA-256 compression itself runs on the
+ * ARMv8 SHA instructions that libcrypto selects at runtime.
+ */
+static void pbkdf2_block(void* arg)
+{
+	struct pbkdf2_lane *lane = arg;
+	unsigned char u[EVP_MAX_MD_SIZE], t[EVP_MAX_MD_SIZE];
+	unsigned char be[4] = { lane->block >> 24, lane->block >> 16,
+				lane->block >> 8, lane->block };
+	unsigned int md_len = EVP_MD_size(lane->md), i, j;
+	HMAC_CTX *ctx = HMAC_CTX_new();
+
+	/*
+	 * Copy only into the fresh ctx: BoringSSL's HMAC_CTX_copy() re-inits
+	 * dest without freeing it. Later iterations rewind to the keyed pads
+	 * with HMAC_Init_ex(), which reuses the ctx's digest state.
+	 */
+	lane->rc = -1;
+	if (!ctx || !HMAC_CTX_copy(ctx, lane->keyed))
+		goto out;
+
+	if (!HMAC_Update(ctx, lane->salt, lane->salt_len) ||
+	    !HMAC_Update(ctx, be, sizeof(be)) ||
+	    !HMAC_Final(ctx, u, &md_len))
+		goto out;
+	memcpy(t, u, md_len);
+
+	for (i = 1; i < lane->iterations; i++) {
+		if (!HMAC_Init_ex(ctx, NULL, 0, NULL, NULL) ||
+		    !HMAC_Update(ctx, u, md_len) ||
+		    !HMAC_Final(ctx, u, &md_len))
+			goto out;
+		for (j = 0; j < md_len; j++)
+			t[j] ^= u[j];
+	}
+
+	memcpy(lane->out, t, lane->out_len);
+	lane->rc = 0;
+out:
+	OPENSSL_cleanse(u, sizeof(u));
+	OPENSSL_cleanse(t, sizeof(t));
+	HMAC_CTX_free(ctx);
+}
+
+/*
+ * PBKDF2-HMAC-SHA1 (or SHA-256 when sha256 is set) as in RFC 8018, with
+ * one lane per output block spread across the shared worker pool. The
+ * FDE key and IV (32 bytes) are two SHA-1 blocks, so an unlock takes
+ * about half the serial time. Returns 0 on success.
+ */
+int pbkdf2_hw(const char* passwd, const unsigned char* salt, size_t salt_len,
+	      unsigned int iterations, int sha256, unsigned char* out, size_t out_len)
+{
+	struct pbkdf2_lane lanes[PBKDF2_MAX_LANES];
+	struct cryptfs_hw_task_group group;
+	const EVP_MD *md = sha256 ? EVP_sha256() : EVP_sha1();
+	size_t md_len = EVP_MD_size(md), done = 0;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int nlanes, i;
+	uint32_t block = 1;
+	HMAC_CTX *keyed;
+	int rc = 0;
+
+	if (!iterations || !out_len)
+		return -EINVAL;
+	if (cpus < 1)
+		cpus = 1;
+	if (cpus > PBKDF2_MAX_LANES)
+		cpus = PBKDF2_MAX_LANES;
+
+	keyed = HMAC_CTX_new();
+	if (!keyed || !HMAC_Init_ex(keyed, passwd, strlen(passwd), md, NULL)) {
+		HMAC_CTX_free(keyed);
+		return -ENOMEM;
+	}
+
+	while (done < out_len && !rc) {
+		nlanes = (out_len - done + md_len - 1) / md_len;
+		if (nlanes > (unsigned int)cpus)
+			nlanes = cpus;
+
+		for (i = 0; i < nlanes; i++) {
+			lanes[i].keyed = keyed;
+			lanes[i].md = md;
+			lanes[i].salt = salt;
+			lanes[i].salt_len = salt_len;
+			lanes[i].iterations = iterations;
+			lanes[i].block = block + i;
+			lanes[i].out = out + done + i * md_len;
+			lanes[i].out_len = out_len - done - i * md_len < md_len ?
+				out_len - done - i * md_len : md_len;
+		}
+
+		/* An unlock is on the user's critical path; the last lane runs here */
+		cryptfs_hw_group_init(&group, NULL, NULL);
+		for (i = 0; i + 1 < nlanes; i++)
+			cryptfs_hw_pool_submit(&group, pbkdf2_block, &lanes[i],
+					       CRYPTFS_HW_TASK_INTERACTIVE);
+		pbkdf2_block(&lanes[nlanes - 1]);
+		cryptfs_hw_group_wait(&group);
+		cryptfs_hw_group_destroy(&group);
+
+		for (i = 0; i < nlanes; i++) {
+			if (lanes[i].rc)
+				rc = -EIO;
+			done += lanes[i].out_len;
+		}
+		block += nlanes;
+	}
+
+	HMAC_CTX_free(keyed);
+	if (rc)
+		OPENSSL_cleanse(out, out_len);
+	return rc;
+}
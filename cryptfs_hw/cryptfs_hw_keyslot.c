@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2020 The TWRP Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Cryptfs_hw"
+
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <openssl/hmac.h>
+#include <openssl/mem.h>
+#include <openssl/rand.h>
+#include "cutils/log.h"
+#include "cryptfs_hw_keyslot.h"
+
+#define CRYPTFS_HW_KEYSLOT_USAGES			8
+#define CRYPTFS_HW_KEYSLOT_MAC_LEN			32
+
+struct cryptfs_hw_keyslot {
+	int live;
+	int index;
+	unsigned char mac[CRYPTFS_HW_KEYSLOT_MAC_LEN];
+};
+
+/* Kept on one locked page together with the MAC key */
+static struct {
+	unsigned char mac_key[CRYPTFS_HW_KEYSLOT_MAC_LEN];
+	struct cryptfs_hw_keyslot slots[CRYPTFS_HW_KEYSLOT_USAGES];
+} *keyslots;
+
+static pthread_mutex_t keyslot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int keyslot_init()
+{
+	void *p;
+
+	if (keyslots)
+		return 0;
+
+	p = mmap(NULL, sizeof(*keyslots), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	if (mlock(p, sizeof(*keyslots)))
+		SLOGW("%s: Failed to lock key slot table\n", __func__);
+	madvise(p, sizeof(*keyslots), MADV_DONTDUMP);
+
+	keyslots = p;
+	if (!RAND_bytes(keyslots->mac_key, sizeof(keyslots->mac_key))) {
+		munmap(p, sizeof(*keyslots));
+		keyslots = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static int keyslot_mac(const unsigned char *key, size_t len, unsigned char *mac)
+{
+	unsigned int mac_len = CRYPTFS_HW_KEYSLOT_MAC_LEN;
+
+	return HMAC(EVP_sha256(), keyslots->mac_key, sizeof(keyslots->mac_key),
+		    key, len, mac, &mac_len) != NULL;
+}
+
+int cryptfs_hw_keyslot_lookup(int usage, const unsigned char *key, size_t len)
+{
+	unsigned char mac[CRYPTFS_HW_KEYSLOT_MAC_LEN];
+	struct cryptfs_hw_keyslot *slot;
+	int index = -1;
+
+	if (usage < 0 || usage >= CRYPTFS_HW_KEYSLOT_USAGES)
+		return -1;
+
+	pthread_mutex_lock(&keyslot_lock);
+	if (keyslots && keyslot_mac(key, len, mac)) {
+		slot = &keyslots->slots[usage];
+		if (slot->live && !CRYPTO_memcmp(slot->mac, mac, sizeof(mac)))
+			index = slot->index;
+	}
+	pthread_mutex_unlock(&keyslot_lock);
+	OPENSSL_cleanse(mac, sizeof(mac));
+	return index;
+}
+
+void cryptfs_hw_keyslot_store(int usage, const unsigned char *key, size_t len, int index)
+{
+	struct cryptfs_hw_keyslot *slot;
+
+	if (usage < 0 || usage >= CRYPTFS_HW_KEYSLOT_USAGES)
+		return;
+
+	pthread_mutex_lock(&keyslot_lock);
+	if (!keyslot_init()) {
+		slot = &keyslots->slots[usage];
+		slot->live = keyslot_mac(key, len, slot->mac);
+		slot->index = index;
+	}
+	pthread_mutex_unlock(&keyslot_lock);
+}
+
+void cryptfs_hw_keyslot_invalidate(int usage)
+{
+	if (usage < 0 || usage >= CRYPTFS_HW_KEYSLOT_USAGES)
+		return;
+
+	pthread_mutex_lock(&keyslot_lock);
+	if (keyslots)
+		OPENSSL_cleanse(&keyslots->slots[usage], sizeof(keyslots->slots[usage]));
+	pthread_mutex_unlock(&keyslot_lock);
+}
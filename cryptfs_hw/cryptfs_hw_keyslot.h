@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2020 The TWRP Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CRYPTFS_HW_KEYSLOT_H_
+#define __CRYPTFS_HW_KEYSLOT_H_
+
+#include <stddef.h>
+
+/*
+ * Remembers which key is live in the key slot of each key management
+ * usage, so that programming the same key again can skip the TEE call.
+ * Keys are identified by an HMAC-SHA256 under a per-process random key;
+ * the key material itself is never stored.
+ */
+
+/* Returns the cached key index, or -1 if the slot does not hold this key */
+int cryptfs_hw_keyslot_lookup(int usage, const unsigned char *key, size_t len);
+void cryptfs_hw_keyslot_store(int usage, const unsigned char *key, size_t len, int index);
+void cryptfs_hw_keyslot_invalidate(int usage);
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2020 The TWRP Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Cryptfs_hw"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "cutils/log.h"
+#include "cryptfs_hw_log.h"
+
+#define CRYPTFS_HW_LOG_RING_SIZE			64	/* power of two */
+
+struct cryptfs_hw_log_event {
+	uint64_t ts_ns;
+	int32_t err;
+	pid_t tid;
+	uint16_t op;
+};
+
+/*
+ * One ring per thread. Rings are never freed: a thread that exits hands
+ * its ring back through the pthread key destructor and the next new
+ * thread picks it up, so the list only grows to the peak thread count.
+ */
+struct cryptfs_hw_log_ring {
+	struct cryptfs_hw_log_ring *next;
+	atomic_int in_use;
+	pid_t tid;
+	atomic_uint head;
+	struct cryptfs_hw_log_event ev[CRYPTFS_HW_LOG_RING_SIZE];
+};
+
+static _Atomic(struct cryptfs_hw_log_ring *) rings;
+static __thread struct cryptfs_hw_log_ring *thread_ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static const char *op_names[CRYPTFS_HW_LOG_OP_MAX] = {
+	[CRYPTFS_HW_LOG_HW_DISK_ENCRYPTION]	= "is_hw_disk_encryption",
+	[CRYPTFS_HW_LOG_ICE_METADATA]		= "is_ice_enabled: metadata partition",
+	[CRYPTFS_HW_LOG_ICE_STORAGE]		= "is_ice_enabled: storage type",
+	[CRYPTFS_HW_LOG_QSEECOM_LOADED]		= "load_qseecom_library",
+	[CRYPTFS_HW_LOG_CREATE_KEY]		= "create_key",
+	[CRYPTFS_HW_LOG_KEYSLOT_HIT]		= "create_key: slot already live",
+	[CRYPTFS_HW_LOG_UPDATE_KEY]		= "update_key",
+	[CRYPTFS_HW_LOG_WIPE_KEY]		= "wipe_key",
+	[CRYPTFS_HW_LOG_KEYMASTER_VERSION]	= "keymaster_version",
+};
+
+static void ring_release(void *ring)
+{
+	atomic_store(&((struct cryptfs_hw_log_ring *)ring)->in_use, 0);
+}
+
+static void ring_key_init(void)
+{
+	pthread_key_create(&ring_key, ring_release);
+}
+
+static struct cryptfs_hw_log_ring *ring_get(void)
+{
+	struct cryptfs_hw_log_ring *ring;
+	int unused;
+
+	for (ring = atomic_load(&rings); ring; ring = ring->next) {
+		unused = 0;
+		if (atomic_compare_exchange_strong(&ring->in_use, &unused, 1))
+			break;
+	}
+
+	if (!ring) {
+		ring = calloc(1, sizeof(*ring));
+		if (!ring)
+			return NULL;
+		atomic_init(&ring->in_use, 1);
+		ring->next = atomic_load(&rings);
+		while (!atomic_compare_exchange_weak(&rings, &ring->next, ring))
+			;
+	}
+
+	ring->tid = syscall(__NR_gettid);
+	pthread_once(&ring_key_once, ring_key_init);
+	pthread_setspecific(ring_key, ring);
+	thread_ring = ring;
+	return ring;
+}
+
+void cryptfs_hw_log(enum cryptfs_hw_log_op op, int32_t err)
+{
+	struct cryptfs_hw_log_ring *ring = thread_ring;
+	struct cryptfs_hw_log_event *ev;
+	struct timespec ts;
+	unsigned int head;
+
+	if (!ring && !(ring = ring_get()))
+		return;
+
+	/* CLOCK_MONOTONIC is served from the vDSO, no syscall */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	ev = &ring->ev[head & (CRYPTFS_HW_LOG_RING_SIZE - 1)];
+	ev->ts_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	ev->err = err;
+	ev->tid = ring->tid;
+	ev->op = op;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/*
+ * Rings are read without stopping their writers; an event being written
+ * while we flush may come out torn, which is acceptable for a debug dump.
+ */
+void cryptfs_hw_log_flush(int fd)
+{
+	struct cryptfs_hw_log_ring *ring;
+	struct cryptfs_hw_log_event ev;
+	unsigned int head, i;
+	const char *name;
+
+	for (ring = atomic_load(&rings); ring; ring = ring->next) {
+		head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		i = head > CRYPTFS_HW_LOG_RING_SIZE ? head - CRYPTFS_HW_LOG_RING_SIZE : 0;
+		for (; i < head; i++) {
+			ev = ring->ev[i & (CRYPTFS_HW_LOG_RING_SIZE - 1)];
+			name = ev.op < CRYPTFS_HW_LOG_OP_MAX && op_names[ev.op] ?
+				op_names[ev.op] : "unknown";
+			if (fd < 0)
+				SLOGI("[%d] %llu.%09llu %s: %d\n", ev.tid,
+				      (unsigned long long)(ev.ts_ns / 1000000000ULL),
+				      (unsigned long long)(ev.ts_ns % 1000000000ULL),
+				      name, ev.err);
+			else
+				dprintf(fd, "[%d] %llu.%09llu %s: %d\n", ev.tid,
+					(unsigned long long)(ev.ts_ns / 1000000000ULL),
+					(unsigned long long)(ev.ts_ns % 1000000000ULL),
+					name, ev.err);
+		}
+	}
+}
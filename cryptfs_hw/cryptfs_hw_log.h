@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2020 The TWRP Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CRYPTFS_HW_LOG_H_
+#define __CRYPTFS_HW_LOG_H_
+
+#include <stdint.h>
+
+/*
+ * Binary event log for the crypto path. Call sites record a fixed size
+ * event (opcode, error, timestamp) into a per-thread ring, without any
+ * formatting, locking or syscall. The rings are only turned into text
+ * when cryptfs_hw_log_flush() is called, on error or on demand.
+ */
+
+enum cryptfs_hw_log_op {
+	CRYPTFS_HW_LOG_HW_DISK_ENCRYPTION	= 1,
+	CRYPTFS_HW_LOG_ICE_METADATA,
+	CRYPTFS_HW_LOG_ICE_STORAGE,
+	CRYPTFS_HW_LOG_QSEECOM_LOADED,
+	CRYPTFS_HW_LOG_CREATE_KEY,
+	CRYPTFS_HW_LOG_KEYSLOT_HIT,
+	CRYPTFS_HW_LOG_UPDATE_KEY,
+	CRYPTFS_HW_LOG_WIPE_KEY,
+	CRYPTFS_HW_LOG_KEYMASTER_VERSION,
+	CRYPTFS_HW_LOG_OP_MAX
+};
+
+void cryptfs_hw_log(enum cryptfs_hw_log_op op, int32_t err);
+
+/* Writes all rings to fd, or to logcat if fd is negative */
+void cryptfs_hw_log_flush(int fd);
+
+#endif
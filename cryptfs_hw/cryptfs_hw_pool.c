@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2020 The TWRP Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Cryptfs_hw"
+
+#include <stdatomic.h>
+#include <unistd.h>
+#include "cutils/log.h"
+#include "cryptfs_hw_pool.h"
+
+#define POOL_MAX_WORKERS				8
+#define POOL_DEQUE_SIZE					64	/* power of two */
+
+struct pool_task {
+	void (*fn)(void *);
+	void *arg;
+	struct cryptfs_hw_task_group *group;
+};
+
+/*
+ * A bounded deque under its own lock. The owner pushes and pops at the
+ * tail, thieves take from the head; with at most four cores contending
+ * a short critical section is cheaper than a lock-free deque's fences.
+ */
+struct pool_deque {
+	pthread_mutex_t lock;
+	unsigned int head, tail;
+	struct pool_task tasks[POOL_DEQUE_SIZE];
+};
+
+static struct pool_deque deques[POOL_MAX_WORKERS];
+static struct pool_deque interactive;
+static atomic_int num_workers;
+static atomic_uint next_deque;
+static atomic_int queued;
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static __thread int worker_id = -1;
+
+static int deque_push(struct pool_deque *dq, const struct pool_task *task)
+{
+	int ok = 0;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail - dq->head < POOL_DEQUE_SIZE) {
+		dq->tasks[dq->tail++ & (POOL_DEQUE_SIZE - 1)] = *task;
+		ok = 1;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return ok;
+}
+
+static int deque_pop(struct pool_deque *dq, struct pool_task *task, int steal)
+{
+	int ok = 0;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail != dq->head) {
+		if (steal)
+			*task = dq->tasks[dq->head++ & (POOL_DEQUE_SIZE - 1)];
+		else
+			*task = dq->tasks[--dq->tail & (POOL_DEQUE_SIZE - 1)];
+		ok = 1;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return ok;
+}
+
+/* Interactive work first, then our own deque, then steal */
+static int pool_take(struct pool_task *task)
+{
+	int i, self = worker_id, workers = atomic_load(&num_workers);
+
+	if (deque_pop(&interactive, task, 1))
+		goto found;
+	if (self >= 0 && deque_pop(&deques[self], task, 0))
+		goto found;
+	for (i = 0; i < workers; i++) {
+		if (i != self && deque_pop(&deques[i], task, 1))
+			goto found;
+	}
+	return 0;
+
+found:
+	atomic_fetch_sub(&queued, 1);
+	return 1;
+}
+
+static void task_run(const struct pool_task *task)
+{
+	struct cryptfs_hw_task_group *group = task->group;
+	void (*done)(void *) = group->done;
+	void *done_arg = group->done_arg;
+	int last;
+
+	task->fn(task->arg);
+
+	/* The waiter may free group as soon as it is unlocked */
+	pthread_mutex_lock(&group->lock);
+	last = !--group->pending;
+	if (last)
+		pthread_cond_broadcast(&group->cond);
+	pthread_mutex_unlock(&group->lock);
+
+	if (last && done)
+		done(done_arg);
+}
+
+static void *pool_worker(void *arg)
+{
+	struct pool_task task;
+
+	worker_id = (int)(long)arg;
+	for (;;) {
+		if (pool_take(&task)) {
+			task_run(&task);
+			continue;
+		}
+		pthread_mutex_lock(&idle_lock);
+		while (!atomic_load(&queued))
+			pthread_cond_wait(&idle_cond, &idle_lock);
+		pthread_mutex_unlock(&idle_lock);
+	}
+	return NULL;
+}
+
+static void pool_init()
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t thread;
+	int i;
+
+	if (cpus > POOL_MAX_WORKERS)
+		cpus = POOL_MAX_WORKERS;
+
+	pthread_mutex_init(&interactive.lock, NULL);
+	for (i = 0; i < cpus; i++)
+		pthread_mutex_init(&deques[i].lock, NULL);
+
+	for (i = 0; i < cpus; i++) {
+		if (pthread_create(&thread, NULL, pool_worker, (void *)(long)i)) {
+			SLOGE("%s: Failed to start worker %d\n", __func__, i);
+			break;
+		}
+		pthread_detach(thread);
+		atomic_store(&num_workers, i + 1);
+	}
+}
+
+void cryptfs_hw_group_init(struct cryptfs_hw_task_group *group,
+			   void (*done)(void *), void *done_arg)
+{
+	pthread_mutex_init(&group->lock, NULL);
+	pthread_cond_init(&group->cond, NULL);
+	group->pending = 0;
+	group->done = done;
+	group->done_arg = done_arg;
+}
+
+void cryptfs_hw_group_destroy(struct cryptfs_hw_task_group *group)
+{
+	pthread_cond_destroy(&group->cond);
+	pthread_mutex_destroy(&group->lock);
+}
+
+void cryptfs_hw_pool_submit(struct cryptfs_hw_task_group *group,
+			    void (*fn)(void *), void *arg,
+			    enum cryptfs_hw_task_prio prio)
+{
+	struct pool_task task = { .fn = fn, .arg = arg, .group = group };
+	struct pool_deque *dq;
+	int workers;
+
+	pthread_once(&pool_once, pool_init);
+	workers = atomic_load(&num_workers);
+
+	pthread_mutex_lock(&group->lock);
+	group->pending++;
+	pthread_mutex_unlock(&group->lock);
+
+	if (prio == CRYPTFS_HW_TASK_INTERACTIVE)
+		dq = &interactive;
+	else if (worker_id >= 0)
+		dq = &deques[worker_id];
+	else if (workers)
+		dq = &deques[atomic_fetch_add(&next_deque, 1) % workers];
+	else
+		dq = NULL;
+
+	if (!dq || !deque_push(dq, &task)) {
+		task_run(&task);
+		return;
+	}
+
+	atomic_fetch_add(&queued, 1);
+	pthread_mutex_lock(&idle_lock);
+	pthread_cond_signal(&idle_cond);
+	pthread_mutex_unlock(&idle_lock);
+}
+
+void cryptfs_hw_group_wait(struct cryptfs_hw_task_group *group)
+{
+	struct pool_task task;
+	int pending;
+
+	for (;;) {
+		pthread_mutex_lock(&group->lock);
+		pending = group->pending;
+		pthread_mutex_unlock(&group->lock);
+		if (!pending || !pool_take(&task))
+			break;
+		task_run(&task);
+	}
+
+	pthread_mutex_lock(&group->lock);
+	while (group->pending)
+		pthread_cond_wait(&group->cond, &group->lock);
+	pthread_mutex_unlock(&group->lock);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2020 The TWRP Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CRYPTFS_HW_POOL_H_
+#define __CRYPTFS_HW_POOL_H_
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Process-wide worker pool shared by every parallel stage of the library,
+ * so that they never run more threads than there are CPUs between them.
+ * Each worker owns a deque: it runs its newest task first and, when idle,
+ * steals the oldest task of another worker. Interactive tasks go to a
+ * shared queue that every worker drains before its own deque.
+ */
+
+enum cryptfs_hw_task_prio {
+	CRYPTFS_HW_TASK_NORMAL,
+	CRYPTFS_HW_TASK_INTERACTIVE,
+};
+
+struct cryptfs_hw_task_group {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int pending;
+	/*
+	 * Continuation, run by whichever thread finishes the last task. It
+	 * may run after cryptfs_hw_group_wait() has returned, so it must not
+	 * touch the group.
+	 */
+	void (*done)(void *arg);
+	void *done_arg;
+};
+
+void cryptfs_hw_group_init(struct cryptfs_hw_task_group *group,
+			   void (*done)(void *), void *done_arg);
+void cryptfs_hw_group_destroy(struct cryptfs_hw_task_group *group);
+
+/*
+ * Queues fn(arg) as part of group. If the pool cannot take the task it
+ * is run on the calling thread before returning.
+ */
+void cryptfs_hw_pool_submit(struct cryptfs_hw_task_group *group,
+			    void (*fn)(void *), void *arg,
+			    enum cryptfs_hw_task_prio prio);
+
+/*
+ * Runs queued tasks on the calling thread while there are any, then
+ * sleeps until the last task of group has finished
+ */
+void cryptfs_hw_group_wait(struct cryptfs_hw_task_group *group);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
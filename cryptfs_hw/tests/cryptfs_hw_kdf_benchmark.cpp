@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2020 The TWRP Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <benchmark/benchmark.h>
+#include <openssl/evp.h>
+
+#include "cryptfs_hw.h"
+
+/*
+ * Legacy crypto footers derive the 16 byte key and 16 byte IV with
+ * PBKDF2-HMAC-SHA1 at 2000 iterations (cryptfs HASH_COUNT) from a 16
+ * byte salt. The serial run is libcrypto's own PBKDF2 on one thread.
+ */
+static const unsigned int kFooterIterations = 2000;
+static const size_t kFooterKeyAndIv = 32;
+static const char kPasswd[] = "0000";
+static const unsigned char kSalt[16] = { 0 };
+
+static void BM_pbkdf2_hw(benchmark::State& state) {
+    unsigned char out[kFooterKeyAndIv];
+    unsigned int iterations = state.range(0);
+
+    for (auto _ : state) {
+        if (pbkdf2_hw(kPasswd, kSalt, sizeof(kSalt), iterations, 0, out, sizeof(out))) {
+            state.SkipWithError("pbkdf2_hw failed");
+            break;
+        }
+        benchmark::DoNotOptimize(out);
+    }
+}
+BENCHMARK(BM_pbkdf2_hw)->Arg(kFooterIterations)->Unit(benchmark::kMillisecond);
+
+static void BM_pbkdf2_serial(benchmark::State& state) {
+    unsigned char out[kFooterKeyAndIv];
+    unsigned int iterations = state.range(0);
+
+    for (auto _ : state) {
+        if (!PKCS5_PBKDF2_HMAC_SHA1(kPasswd, strlen(kPasswd), kSalt, sizeof(kSalt),
+                                    iterations, sizeof(out), out)) {
+            state.SkipWithError("PKCS5_PBKDF2_HMAC_SHA1 failed");
+            break;
+        }
+        benchmark::DoNotOptimize(out);
+    }
+}
+BENCHMARK(BM_pbkdf2_serial)->Arg(kFooterIterations)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
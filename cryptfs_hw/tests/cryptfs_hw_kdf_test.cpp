@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2020 The TWRP Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <openssl/evp.h>
+
+#include "cryptfs_hw.h"
+
+namespace {
+
+struct Pbkdf2Vector {
+    const char* passwd;
+    const char* salt;
+    unsigned int iterations;
+    int sha256;
+    const char* hex;
+};
+
+/*
+ * RFC 6070 (SHA-1) and RFC 7914 section 11 (SHA-256). The RFC 6070
+ * vector with 16777216 iterations is left out for run time, and the one
+ * with embedded NULs because pbkdf2_hw() takes a C string password.
+ */
+const Pbkdf2Vector kVectors[] = {
+    { "password", "salt", 1, 0, "0c60c80f961f0e71f3a9b524af6012062fe037a6" },
+    { "password", "salt", 2, 0, "ea6c014dc72d6f8ccd1ed92ace1d41f0d8de8957" },
+    { "password", "salt", 4096, 0, "4b007901b765489abead49d926f721d065a429c1" },
+    { "passwordPASSWORDpassword", "saltSALTsaltSALTsaltSALTsaltSALTsalt", 4096, 0,
+      "3d2eec4fe41c849b80c8d83662c0e44a8b291a964cf2f07038" },
+    { "passwd", "salt", 1, 1,
+      "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+      "49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783" },
+    { "Password", "NaCl", 80000, 1,
+      "4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56"
+      "a1d425a1225833549adb841b51c9b3176a272bdebba1d078478f62b397f33c8d" },
+};
+
+std::string ToHex(const std::vector<unsigned char>& bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned char b : bytes) {
+        hex += digits[b >> 4];
+        hex += digits[b & 0xf];
+    }
+    return hex;
+}
+
+}  // namespace
+
+TEST(CryptfsHwKdfTest, Pbkdf2KnownAnswers) {
+    for (const auto& v : kVectors) {
+        std::vector<unsigned char> out(strlen(v.hex) / 2);
+        ASSERT_EQ(0, pbkdf2_hw(v.passwd, reinterpret_cast<const unsigned char*>(v.salt),
+                               strlen(v.salt), v.iterations, v.sha256, out.data(), out.size()))
+                << v.passwd << "/" << v.iterations;
+        EXPECT_EQ(v.hex, ToHex(out)) << v.passwd << "/" << v.iterations;
+    }
+}
+
+// Every output length up to more blocks than there are lanes
+TEST(CryptfsHwKdfTest, Pbkdf2MatchesSerial) {
+    static const char passwd[] = "cryptfs_hw";
+    static const unsigned char salt[16] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+    for (int sha256 = 0; sha256 <= 1; sha256++) {
+        const EVP_MD* md = sha256 ? EVP_sha256() : EVP_sha1();
+        for (size_t len = 1; len <= 10 * static_cast<size_t>(EVP_MD_size(md)); len++) {
+            std::vector<unsigned char> out(len), expected(len);
+            ASSERT_EQ(1, PKCS5_PBKDF2_HMAC(passwd, strlen(passwd), salt, sizeof(salt), 3, md,
+                                           len, expected.data()));
+            ASSERT_EQ(0, pbkdf2_hw(passwd, salt, sizeof(salt), 3, sha256, out.data(), len));
+            EXPECT_EQ(ToHex(expected), ToHex(out)) << "sha256=" << sha256 << " len=" << len;
+        }
+    }
+}
+
+TEST(CryptfsHwKdfTest, Pbkdf2RejectsEmptyRequests) {
+    unsigned char out[20];
+
+    EXPECT_EQ(-EINVAL, pbkdf2_hw("password", reinterpret_cast<const unsigned char*>("salt"), 4,
+                                 0, 0, out, sizeof(out)));
+    EXPECT_EQ(-EINVAL, pbkdf2_hw("password", reinterpret_cast<const unsigned char*>("salt"), 4,
+                                 1, 0, out, 0));
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2020 The TWRP Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "cryptfs_hw_pool.h"
+
+/*
+ * Task throughput of the shared pool and the cost of stealing, against
+ * the thread per task that the pool replaced. Tasks only bump a counter,
+ * so the numbers are the scheduling overhead alone.
+ */
+
+namespace {
+
+std::atomic<int> ran;
+
+void Nop(void*) {
+    ran.fetch_add(1, std::memory_order_relaxed);
+}
+
+struct Fanout {
+    cryptfs_hw_task_group* group;
+    int children;
+    std::atomic<int> stolen;
+    std::mutex lock;
+    std::condition_variable cond;
+    bool finished;
+};
+
+void Stolen(void* arg) {
+    static_cast<Fanout*>(arg)->stolen.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+ * Runs on a worker and queues the children on that worker's deque, then
+ * keeps the worker busy until all of them have run. The submitting
+ * thread does not help (it waits on the continuation rather than in
+ * cryptfs_hw_group_wait), so every child is taken by a steal.
+ */
+void Spawn(void* arg) {
+    Fanout* fanout = static_cast<Fanout*>(arg);
+    for (int i = 0; i < fanout->children; i++)
+        cryptfs_hw_pool_submit(fanout->group, Stolen, fanout, CRYPTFS_HW_TASK_NORMAL);
+    while (fanout->stolen.load(std::memory_order_relaxed) < fanout->children)
+        sched_yield();
+}
+
+void FanoutDone(void* arg) {
+    Fanout* fanout = static_cast<Fanout*>(arg);
+    std::lock_guard<std::mutex> guard(fanout->lock);
+    fanout->finished = true;
+    fanout->cond.notify_one();
+}
+
+void* NopThread(void* arg) {
+    Nop(arg);
+    return nullptr;
+}
+
+}  // namespace
+
+static void BM_pool_submit_wait(benchmark::State& state) {
+    int tasks = state.range(0);
+    cryptfs_hw_task_group group;
+
+    for (auto _ : state) {
+        cryptfs_hw_group_init(&group, nullptr, nullptr);
+        for (int i = 0; i < tasks; i++)
+            cryptfs_hw_pool_submit(&group, Nop, nullptr, CRYPTFS_HW_TASK_NORMAL);
+        cryptfs_hw_group_wait(&group);
+        cryptfs_hw_group_destroy(&group);
+    }
+    state.SetItemsProcessed(state.iterations() * tasks);
+}
+BENCHMARK(BM_pool_submit_wait)->Arg(1)->Arg(8)->Arg(64)->UseRealTime();
+
+static void BM_pool_interactive(benchmark::State& state) {
+    int tasks = state.range(0);
+    cryptfs_hw_task_group group;
+
+    for (auto _ : state) {
+        cryptfs_hw_group_init(&group, nullptr, nullptr);
+        for (int i = 0; i < tasks; i++)
+            cryptfs_hw_pool_submit(&group, Nop, nullptr, CRYPTFS_HW_TASK_INTERACTIVE);
+        cryptfs_hw_group_wait(&group);
+        cryptfs_hw_group_destroy(&group);
+    }
+    state.SetItemsProcessed(state.iterations() * tasks);
+}
+BENCHMARK(BM_pool_interactive)->Arg(8)->Arg(64)->UseRealTime();
+
+static void BM_pool_steal(benchmark::State& state) {
+    cryptfs_hw_task_group group;
+    Fanout fanout;
+
+    // Stealing needs a second worker; the pool has one per online CPU
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        state.SkipWithError("needs at least two CPUs");
+        return;
+    }
+
+    fanout.group = &group;
+    fanout.children = state.range(0);
+    for (auto _ : state) {
+        fanout.stolen = 0;
+        fanout.finished = false;
+        cryptfs_hw_group_init(&group, FanoutDone, &fanout);
+        cryptfs_hw_pool_submit(&group, Spawn, &fanout, CRYPTFS_HW_TASK_NORMAL);
+        {
+            std::unique_lock<std::mutex> guard(fanout.lock);
+            fanout.cond.wait(guard, [&fanout] { return fanout.finished; });
+        }
+        cryptfs_hw_group_destroy(&group);
+    }
+    state.SetItemsProcessed(state.iterations() * fanout.children);
+    state.counters["steals"] = benchmark::Counter(state.iterations() * fanout.children,
+                                                  benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_pool_steal)->Arg(8)->Arg(63)->UseRealTime();
+
+static void BM_thread_per_task(benchmark::State& state) {
+    int tasks = state.range(0);
+    std::vector<pthread_t> threads(tasks);
+
+    for (auto _ : state) {
+        for (int i = 0; i < tasks; i++)
+            pthread_create(&threads[i], nullptr, NopThread, nullptr);
+        for (int i = 0; i < tasks; i++)
+            pthread_join(threads[i], nullptr);
+    }
+    state.SetItemsProcessed(state.iterations() * tasks);
+}
+BENCHMARK(BM_thread_per_task)->Arg(1)->Arg(8)->Arg(64)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,91 @@
+#!/sbin/sh
+#
+# Copyright (C) 2020 The TWRP Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Recovery boot timeline recorder.
+#
+#   boottrace.sh mark <event>   stamp <event> with the time since boot
+#   boottrace.sh dump [file]    write the timeline as a Chrome trace
+#
+# Events ending in _begin/_end are emitted as spans, everything else as
+# instants. The ro.boottime.* properties init records for each service
+# start are merged in. Marks are only taken when the kernel command line
+# carries androidboot.boottrace=1, see init.recovery.qcom.rc. The UI
+# has no property for its first frame, so it is stamped by running
+# "boottrace.sh mark first_frame" once the main page is drawn.
+
+RING=/dev/boottrace
+RING_SIZE=128
+OUT=/tmp/boottrace.json
+
+# /proc/uptime has 10ms resolution, which is plenty for boot stages
+now_us() {
+	read up idle < /proc/uptime
+	frac=${up#*.}
+	echo $(( ${up%.*} * 1000000 + ${frac#0} * 10000 ))
+}
+
+mark() {
+	echo "$(now_us) $1" >> $RING
+	if [ $(wc -l < $RING) -gt $RING_SIZE ]; then
+		tail -n $RING_SIZE $RING > $RING.tmp
+		mv $RING.tmp $RING
+	fi
+}
+
+# Print "<ts> <phase> <name>" for every recorded event
+events() {
+	getprop | sed -n 's/^\[ro\.boottime\.\([^].]*\)\]: \[\([0-9]*\)\]/\1 \2/p' |
+	while read name ns; do
+		echo "$(( ns / 1000 )) i start:$name"
+	done
+	[ -f $RING ] && while read ts name; do
+		case "$name" in
+		*_begin) echo "$ts B ${name%_begin}" ;;
+		*_end) echo "$ts E ${name%_end}" ;;
+		*) echo "$ts i $name" ;;
+		esac
+	done < $RING
+}
+
+dump() {
+	{
+		echo "{\"traceEvents\":["
+		events | sort -n | {
+			sep=
+			while read ts ph name; do
+				[ -n "$sep" ] && echo ","
+				sep=1
+				echo -n "  {\"name\":\"$name\",\"ph\":\"$ph\",\"ts\":$ts,\"pid\":1,\"tid\":1,\"s\":\"g\"}"
+			done
+			echo
+		}
+		echo "],\"displayTimeUnit\":\"ms\"}"
+	} > "$1"
+}
+
+case "$1" in
+mark)
+	[ -n "$2" ] && mark "$2"
+	;;
+dump)
+	dump "${2:-$OUT}"
+	;;
+*)
+	echo "usage: $0 mark <event> | dump [file]"
+	exit 1
+	;;
+esac
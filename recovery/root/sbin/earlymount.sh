@@ -0,0 +1,39 @@
+#!/sbin/sh
+#
+# Copyright (C) 2020 The TWRP Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Reads twrp.fstab once and probes every fixed partition in parallel
+# through fsprobe.sh, which caches type, size and by-name link and
+# leaves the superblock area in the page cache. The sequential probe
+# and mount recovery does at startup then no longer waits on eMMC for
+# each one in turn.
+#
+# Nothing is mounted here. This runs in the background from "on fs",
+# and recovery starts a few milliseconds later and mounts /cache for its
+# logs straight away; a mount from here would race it. Removable
+# storage is skipped.
+
+FSTAB=/etc/twrp.fstab
+while read mnt fs dev rest; do
+	case "$mnt" in
+	/external_sd|""|\#*) continue ;;
+	esac
+	case "$rest" in
+	*removable*) continue ;;
+	esac
+	[ -b "$dev" ] && /sbin/fsprobe.sh probe "$mnt" "$dev" &
+done < $FSTAB
+wait
@@ -0,0 +1,120 @@
+#!/sbin/sh
+#
+# Copyright (C) 2020 The TWRP Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Block device probe cache shared by the mounter, the backup size
+# estimator and the partition list.
+#
+#   fsprobe.sh probe <mnt> <dev>  read the device once and cache it
+#   fsprobe.sh get <mnt>          print the cached entry
+#   fsprobe.sh invalidate <mnt>   drop the entry, e.g. after a format
+#
+# An entry holds the filesystem type found in the superblock, the size
+# in bytes, the by-name link and the device number:
+#
+#   dev=/dev/block/mmcblk0p25 name=cache fs=ext4 size=126877696 devnum=179:25
+#
+# The superblock is the only read that touches the device; size and
+# device number come from sysfs. "get" re-probes when the device number
+# or size in sysfs differs, which catches a swapped card or a changed
+# partition table. A format changes neither and raises no uevent, so
+# "get" also re-reads the superblock magic, a few bytes that are
+# normally in the page cache. A formatter can also drop the entry up
+# front with "invalidate", directly or through setprop
+# twrp.fsprobe.invalidate <mnt> (see init.recovery.qcom.rc).
+# earlymount.sh fills the cache for every twrp.fstab entry in parallel
+# at startup.
+
+CACHE=/tmp/fsprobe
+SB_SIZE=64
+
+entry_file() {
+	echo $CACHE/$(echo "$1" | tr / _)
+}
+
+sysfs_of() {
+	echo /sys/class/block/${1##*/}
+}
+
+# Filesystem type from the superblock magic of a device or of a copy of
+# its first SB_SIZE KiB
+fs_type() {
+	magic=$(dd if=$1 bs=1 skip=1080 count=2 2>/dev/null | od -An -tx1 | tr -d ' \n')
+	[ "$magic" = "53ef" ] && { echo ext4; return; }
+	magic=$(dd if=$1 bs=1 skip=1024 count=4 2>/dev/null | od -An -tx1 | tr -d ' \n')
+	[ "$magic" = "1020f5f2" ] && { echo f2fs; return; }
+	magic=$(dd if=$1 bs=1 skip=82 count=3 2>/dev/null)
+	[ "$magic" = "FAT" ] && { echo vfat; return; }
+	magic=$(dd if=$1 bs=1 skip=54 count=3 2>/dev/null)
+	[ "$magic" = "FAT" ] && { echo vfat; return; }
+	echo none
+}
+
+probe() {
+	real=$(readlink -f $2)
+	[ -b "$real" ] || return 1
+	sys=$(sysfs_of $real)
+	mkdir -p $CACHE
+	sb=$(entry_file $1).sb
+	dd if=$real of=$sb bs=1k count=$SB_SIZE 2>/dev/null
+	name=
+	case "$2" in
+	*/by-name/*) name=${2##*/} ;;
+	esac
+	echo "dev=$real name=$name fs=$(fs_type $sb)" \
+		"size=$(( $(cat $sys/size) * 512 ))" \
+		"devnum=$(cat $sys/dev)" > $(entry_file $1)
+	rm -f $sb
+}
+
+invalidate() {
+	rm -f $(entry_file $1)
+}
+
+get() {
+	f=$(entry_file $1)
+	if [ -f $f ]; then
+		for kv in $(cat $f); do
+			eval ${kv%%=*}=\${kv#*=}
+		done
+		sys=$(sysfs_of $dev)
+		if [ "$(cat $sys/dev 2>/dev/null)" = "$devnum" ] &&
+		   [ $(( $(cat $sys/size 2>/dev/null || echo 0) * 512 )) -eq $size ] &&
+		   [ "$(fs_type $dev)" = "$fs" ]; then
+			cat $f
+			return
+		fi
+	fi
+	# Missing or stale, probe again using the fstab block device
+	blk=$(grep "^$1[[:space:]]" /etc/twrp.fstab | awk '{print $3}')
+	[ -n "$blk" ] && probe $1 $blk && cat $f
+}
+
+case "$1" in
+probe)
+	probe "$2" "$3"
+	;;
+get)
+	get "$2"
+	;;
+invalidate)
+	invalidate "$2"
+	;;
+*)
+	echo "usage: $0 probe <mnt> <dev> | get <mnt> | invalidate <mnt>"
+	exit 1
+	;;
+esac
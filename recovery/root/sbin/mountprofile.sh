@@ -0,0 +1,94 @@
+#!/sbin/sh
+#
+# Copyright (C) 2020 The TWRP Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Operation-scoped ext4 mount profiles for restores and bulk copies.
+#
+#   mountprofile.sh begin [mnt...]       remount with the bulk profile
+#   mountprofile.sh end [mnt...]         sync and put the old options back
+#   mountprofile.sh run <mnt,...> <cmd>  begin, run cmd, then always end
+#
+# Without mount points /data, /system and /cache are used. The same can
+# be selected with setprop twrp.mount.profile bulk|default, see
+# init.recovery.qcom.rc.
+#
+# data=writeback is not part of the profile: ext4 refuses to change the
+# journalling mode on remount, and unmounting /data under a running
+# restore is not an option.
+
+DEFAULT_MOUNTS="/data /system /cache"
+BULK_OPTS="noatime,commit=60,nodiscard"
+# ext4 default, used when the saved options carry no commit=
+DEFAULT_COMMIT=5
+STATE=/tmp/mountprofile
+
+state_file() {
+	echo $STATE$(echo "$1" | tr / _)
+}
+
+begin() {
+	m=$1
+	set -- $(grep " $m " /proc/mounts)
+	[ "$3" = "ext4" ] || return
+	f=$(state_file $m)
+	[ -f $f ] && return
+	echo $4 > $f
+	mount -o remount,$BULK_OPTS $m || rm -f $f
+}
+
+end() {
+	f=$(state_file $1)
+	[ -f $f ] || return
+	sync
+	opts=$(tr ',' '\n' < $f | grep -v '^seclabel$' | tr '\n' ',')
+	opts=${opts%,}
+	case ",$opts," in
+	*,commit=*) ;;
+	*) opts=$opts,commit=$DEFAULT_COMMIT ;;
+	esac
+	mount -o remount,$opts $1
+	rm -f $f
+}
+
+each() {
+	action=$1
+	shift
+	[ $# -eq 0 ] && set -- $DEFAULT_MOUNTS
+	for m in "$@"; do
+		$action $m
+	done
+}
+
+case "$1" in
+begin|end)
+	action=$1
+	shift
+	each $action "$@"
+	;;
+run)
+	mounts=$(echo "$2" | tr ',' ' ')
+	shift 2
+	trap 'each end $mounts' EXIT
+	trap 'exit 1' INT TERM
+	each begin $mounts
+	"$@"
+	exit $?
+	;;
+*)
+	echo "usage: $0 begin [mnt...] | end [mnt...] | run <mnt,...> <cmd...>"
+	exit 1
+	;;
+esac
@@ -0,0 +1,159 @@
+#!/sbin/sh
+#
+# Copyright (C) 2020 The TWRP Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# CPU performance profiles for heavy recovery work (decrypt, backup,
+# compression, flashing).
+#
+#   perfprofile.sh boost [pid...]  floor every cpufreq policy at its max
+#                                  frequency, keep the CPUs out of low
+#                                  power modes and spread the threads of
+#                                  each pid over the CPUs
+#   perfprofile.sh idle            restore the state saved by boost
+#   perfprofile.sh run <cmd...>    boost, run cmd, then always restore
+#
+# The same profiles can be selected with setprop twrp.perf.profile
+# boost|idle, see init.recovery.qcom.rc. Boosts nest: only the first one
+# saves the state and only the matching last idle restores it.
+
+CPU=/sys/devices/system/cpu
+LPM=/sys/module/lpm_levels/parameters/sleep_disabled
+STATE=/tmp/perfprofile.state
+COUNT=/tmp/perfprofile.count
+
+# The first CPU of every cpufreq policy. msm8916 is a single cluster, so
+# this is just cpu0, but the same code copes with big.LITTLE parts.
+policies() {
+	for c in $CPU/cpu[0-9]*; do
+		[ -f $c/cpufreq/related_cpus ] || continue
+		read first rest < $c/cpufreq/related_cpus
+		[ "$c" = "$CPU/cpu$first" ] && echo $first
+	done
+}
+
+# The online CPUs, expanded from a list such as "0-3" or "0,2-3"
+cpus() {
+	for r in $(tr ',' ' ' < $CPU/online); do
+		c=${r%-*}
+		while [ $c -le ${r#*-} ]; do
+			echo $c
+			c=$(( c + 1 ))
+		done
+	done
+}
+
+save() {
+	{
+		echo "lpm $(cat $LPM 2>/dev/null)"
+		for p in $(policies); do
+			echo "min $p $(cat $CPU/cpu$p/cpufreq/scaling_min_freq)"
+		done
+	} > $STATE
+}
+
+restore() {
+	[ -f $STATE ] || return
+	while read key a b; do
+		case $key in
+		min) echo $b > $CPU/cpu$a/cpufreq/scaling_min_freq ;;
+		lpm) [ -n "$a" ] && echo $a > $LPM ;;
+		esac
+	done < $STATE
+	rm -f $STATE
+}
+
+# Round-robin the threads of a process over the online CPUs. The main
+# thread keeps its full mask: threads inherit their creator's affinity,
+# so pinning it would confine everything the job starts later to one CPU.
+# Threads already in $pinned are left alone.
+pin() {
+	set -- $(cpus)
+	n=$#
+	for t in /proc/$pin_pid/task/*; do
+		tid=${t##*/}
+		[ "$tid" = "$pin_pid" ] && continue
+		case " $pinned " in *" $tid "*) continue ;; esac
+		eval cpu=\${$(( i % n + 1 ))}
+		taskset -p $(printf %x $(( 1 << cpu ))) $tid > /dev/null 2>&1
+		pinned="$pinned $tid"
+		i=$(( i + 1 ))
+	done
+}
+
+# kill -0 still succeeds on a zombie, so look at the task state
+alive() {
+	[ -f /proc/$1/status ] && ! grep -q '^State:[[:space:]]*Z' /proc/$1/status
+}
+
+boost() {
+	count=$(cat $COUNT 2>/dev/null)
+	count=$(( ${count:-0} + 1 ))
+	echo $count > $COUNT
+	if [ $count -eq 1 ]; then
+		save
+		for p in $(policies); do
+			cat $CPU/cpu$p/cpufreq/cpuinfo_max_freq > $CPU/cpu$p/cpufreq/scaling_min_freq
+		done
+		[ -f $LPM ] && echo 1 > $LPM
+	fi
+	for pin_pid in "$@"; do
+		pinned=
+		i=0
+		[ -d /proc/$pin_pid ] && pin
+	done
+}
+
+idle() {
+	count=$(cat $COUNT 2>/dev/null)
+	count=$(( ${count:-1} - 1 ))
+	if [ $count -le 0 ]; then
+		rm -f $COUNT
+		restore
+	else
+		echo $count > $COUNT
+	fi
+}
+
+case "$1" in
+boost)
+	shift
+	boost "$@"
+	;;
+idle)
+	idle
+	;;
+run)
+	shift
+	trap idle EXIT
+	trap 'exit 1' INT TERM
+	boost
+	"$@" &
+	pin_pid=$!
+	pinned=
+	i=0
+	# The job starts with only its main thread; pin workers as they appear
+	while alive $pin_pid; do
+		sleep 1
+		alive $pin_pid && pin
+	done
+	wait $pin_pid
+	exit $?
+	;;
+*)
+	echo "usage: $0 boost [pid...] | idle | run <cmd...>"
+	exit 1
+	;;
+esac
@@ -0,0 +1,79 @@
+#!/sbin/sh
+#
+# Copyright (C) 2020 The TWRP Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Start the QSEECom listeners while the UI is still coming up, so that
+# sys.keymaster.loaded is already set by the time the password prompt
+# calls into libcryptfs_hw. Only done when the crypto footer that the
+# /data "encryptable=" flag points to carries the cryptfs magic.
+
+FSTAB=/etc/twrp.fstab
+LINKER=/system/bin/linker64
+
+# Vendor blobs on the decrypt path, from recovery/root/vendor/lib64:
+# qseecomd links libQSEEComAPI and libdrmfs and dlopens its listeners
+# (rpmb, ssd, secureui, drmtime) as soon as it starts; recovery dlopens
+# the keystore HAL at the password prompt. The rest are their vendor
+# DT_NEEDED entries. Core libraries are left out, every recovery process
+# already has them mapped.
+VENDOR=/vendor/lib64
+BLOBS="libQSEEComAPI.so libdrmfs.so librpmb.so libssd.so libsecureui.so
+	libdrmtime.so hw/keystore.msm8916.so libdiag.so lib-sec-disp.so
+	libStDrvInt.so libsecureui_svcsock.so libtime_genoff.so"
+
+footer=$(grep '^/data[[:space:]]' $FSTAB | sed -n 's/.*encryptable=\([^;[:space:]]*\).*/\1/p')
+[ -n "$footer" ] || exit 0
+[ -b "$footer" ] || exit 0
+
+# struct crypt_mnt_ftr starts with CRYPT_MNT_MAGIC 0xD0B5B1C4 (little endian)
+magic=$(dd if="$footer" bs=4 count=1 2>/dev/null | od -An -tx1 | tr -d ' \n')
+[ "$magic" = "c4b1b5d0" ] || exit 0
+
+# qseecomd is linked against $LINKER and loads its TAs from
+# /firmware/image. Neither is guaranteed this early, so mount the modem
+# partition read-only here and otherwise leave the start to the
+# ro.crypto.state trigger in init.recovery.qcom.rc.
+[ -x $LINKER ] || exit 0
+if ! grep -q ' /firmware ' /proc/mounts; then
+	firmware=$(grep '^/firmware[[:space:]]' $FSTAB | awk '{ print $3 }')
+	[ -b "$firmware" ] || exit 0
+	mkdir -p /firmware
+	mount -t vfat -o ro,shortname=lower "$firmware" /firmware || exit 0
+	mounted=1
+fi
+if [ ! -d /firmware/image ]; then
+	[ -n "$mounted" ] && umount /firmware
+	exit 0
+fi
+
+for blob in $BLOBS; do
+	[ -f $VENDOR/$blob ] && cat $VENDOR/$blob > /dev/null &
+done
+[ -f /sbin/qseecomd ] && cat /sbin/qseecomd > /dev/null
+wait
+
+setprop ctl.start sbinqseecomd
+
+# If the keymaster TA did not load, a running daemon would turn the later
+# "start sbinqseecomd" into a no-op. Stop it so that start gets a fresh
+# daemon, and restart it here if the trigger has already fired.
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	[ "$(getprop sys.keymaster.loaded)" = "true" ] && exit 0
+	sleep 1
+done
+setprop ctl.stop sbinqseecomd
+[ "$(getprop ro.crypto.state)" = "encrypted" ] && setprop ctl.start sbinqseecomd
+exit 0
@@ -0,0 +1,185 @@
+#!/sbin/sh
+#
+# Copyright (C) 2020 The TWRP Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Sustained-throughput controller for long jobs. Runs while a
+# perfprofile boost is active and holds the hottest thermal zone just
+# under TARGET, below the point where msm_thermal starts its hard
+# throttling, by stepping the boosted frequency of every policy down
+# and back up one OPP at a time.
+#
+# It exits by itself once twrp.perf.profile leaves "boost". Each step
+# publishes:
+#   twrp.thermal.level    0 (full speed) .. number of OPPs below max
+#   twrp.thermal.workers  suggested worker thread count
+#   twrp.thermal.compress suggested compression level (0 = fastest)
+#   twrp.thermal.rate     block device write throughput in KiB/s
+# so the backup pipeline can shed threads and compression effort.
+#
+# With setprop twrp.thermal.blank 1 the backlight is switched off once
+# throttling starts, to shed the display's share of the heat. It is
+# restored when the controller stops.
+
+CPU=/sys/devices/system/cpu
+BRIGHTNESS=/sys/class/leds/lcd-backlight/brightness
+TARGET=70
+HYST=3
+INTERVAL=2
+SAVED=/tmp/thermalctl.state
+LIMITS=/tmp/thermalctl.limits
+BOOST_STATE=/tmp/perfprofile.state
+
+policies() {
+	for c in $CPU/cpu[0-9]*; do
+		[ -f $c/cpufreq/related_cpus ] || continue
+		read first rest < $c/cpufreq/related_cpus
+		[ "$c" = "$CPU/cpu$first" ] && echo $first
+	done
+}
+
+# Hottest zone in degrees C; tsens reports C, newer drivers mC
+max_temp() {
+	max=0
+	for z in /sys/class/thermal/thermal_zone*/temp; do
+		read t < $z 2>/dev/null || continue
+		[ $t -gt 1000 ] && t=$(( t / 1000 ))
+		[ $t -gt $max ] && max=$t
+	done
+	echo $max
+}
+
+# Bytes written to the eMMC, SD card and USB disks. Backups are written
+# by tar, pigz and openaes children of recovery, which per-process I/O
+# counters of recovery itself never see.
+written() {
+	sectors=0
+	for s in /sys/block/mmcblk*/stat /sys/block/sd*/stat; do
+		[ -f $s ] || continue
+		set -- $(cat $s)
+		sectors=$(( sectors + $7 ))
+	done
+	echo $(( sectors * 512 ))
+}
+
+# Save every policy's frequency limits before the first step. The floor
+# saved is the one from before the boost: perfprofile.sh records it
+# before raising it, so if its state file exists after the read, the
+# read may have seen the boosted floor and the recorded one wins.
+save_limits() {
+	for p in $(policies); do
+		f=$CPU/cpu$p/cpufreq
+		min=$(cat $f/scaling_min_freq)
+		boosted=$(sed -n "s/^min $p //p" $BOOST_STATE 2>/dev/null)
+		echo "$p ${boosted:-$min} $(cat $f/scaling_max_freq)"
+	done > $LIMITS
+}
+
+# Put back the saved cap, and the floor that matches the current profile:
+# perfprofile's boosted one while it is still active, the original one
+# once it has gone idle (perfprofile restores the same value).
+restore_limits() {
+	[ -f $LIMITS ] || return
+	while read p min max; do
+		f=$CPU/cpu$p/cpufreq
+		if [ "$(getprop twrp.perf.profile)" = "boost" ]; then
+			min=$(cat $f/cpuinfo_max_freq)
+			[ $min -gt $max ] && min=$max
+		fi
+		if [ $min -gt $(cat $f/scaling_max_freq) ]; then
+			echo $max > $f/scaling_max_freq
+			echo $min > $f/scaling_min_freq
+		else
+			echo $min > $f/scaling_min_freq
+			echo $max > $f/scaling_max_freq
+		fi
+	done < $LIMITS
+	rm -f $LIMITS
+}
+
+# Pin policy $1 to the OPP $2 steps below its maximum
+set_level() {
+	p=$CPU/cpu$1/cpufreq
+	set -- $1 $2 $(tr ' ' '\n' < $p/scaling_available_frequencies | sort -rn)
+	n=$(( $# - 2 ))
+	i=$(( $2 + 3 ))
+	[ $i -gt $(( n + 2 )) ] && i=$(( n + 2 ))
+	eval f=\${$i}
+	cur=$(cat $p/scaling_max_freq)
+	if [ $f -lt $cur ]; then
+		echo $f > $p/scaling_min_freq
+		echo $f > $p/scaling_max_freq
+	else
+		echo $f > $p/scaling_max_freq
+		echo $f > $p/scaling_min_freq
+	fi
+}
+
+publish() {
+	ncpu=$(ls -d $CPU/cpu[0-9]* | wc -l)
+	workers=$(( ncpu - level ))
+	[ $workers -lt 1 ] && workers=1
+	compress=$(( level > 3 ? 0 : 3 - level ))
+	setprop twrp.thermal.level $level
+	setprop twrp.thermal.workers $workers
+	setprop twrp.thermal.compress $compress
+}
+
+stop_ctl() {
+	restore_limits
+	if [ -f $SAVED ]; then
+		cat $SAVED > $BRIGHTNESS
+		rm -f $SAVED
+	fi
+	setprop twrp.thermal.level 0
+	exit 0
+}
+
+trap stop_ctl INT TERM
+
+set -- $(cat $CPU/cpu0/cpufreq/scaling_available_frequencies)
+max_level=$(( $# - 1 ))
+level=0
+last=$(written)
+save_limits
+publish
+while [ "$(getprop twrp.perf.profile)" = "boost" ]; do
+	sleep $INTERVAL
+	# perfprofile may have restored the floor while we slept
+	[ "$(getprop twrp.perf.profile)" = "boost" ] || break
+	temp=$(max_temp)
+	now=$(written)
+	setprop twrp.thermal.rate $(( (${now:-0} - ${last:-0}) / 1024 / INTERVAL ))
+	last=$now
+
+	old=$level
+	if [ $temp -ge $(( TARGET + HYST )) ] && [ $level -lt $max_level ]; then
+		level=$(( level + 1 ))
+	elif [ $temp -le $(( TARGET - HYST )) ] && [ $level -gt 0 ]; then
+		level=$(( level - 1 ))
+	fi
+	[ $level -eq $old ] && continue
+
+	for p in $(policies); do
+		set_level $p $level
+	done
+	publish
+
+	if [ "$(getprop twrp.thermal.blank)" = "1" ] && [ $level -gt 0 ] && [ ! -f $SAVED ]; then
+		cat $BRIGHTNESS > $SAVED
+		echo 0 > $BRIGHTNESS
+	fi
+done
+stop_ctl